@@ -0,0 +1,142 @@
+#include <scanner.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+/*
+
+Planner benchmark:
+Builds a synthetic image with a code-like byte distribution (lots of zero bytes,
+common x86 opcodes, sprinkled text), runs every usable kernel for a set of
+patterns and checks that:
+1. all kernels return the same matches
+2. the kernel picked by plan_scan is the fastest one (within 10%)
+Exits with 1 if any check fails. The cost constants in planner.cpp were tuned with it,
+so timings are only meaningful in an optimized build (-O2 is forced outside MSVC, use Release there).
+
+Usage: planner-bench [image size in MB, default 64] [--matches-only]
+--matches-only reports the picks but only fails on check 1, for noisy machines like CI runners
+
+*/
+
+using namespace patterns;
+
+std::vector<uint8_t> synthetic_image(size_t size, uint32_t seed)
+{
+    const uint8_t common[] = { 0xFF, 0x8B, 0x48, 0x89, 0x45, 0x24, 0x0F, 0xE8, 0x83, 0xC3, 0xCC, 0x4C, 0x85, 0x74, 0x75, 0x00 };
+    const char* text = "Welcome to Trial Version of the program";
+
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> image(size);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        uint32_t r = rng() % 100;
+        if (r < 25)
+            image[i] = 0;
+        else if (r < 55)
+            image[i] = common[rng() % 16];
+        else
+            image[i] = static_cast<uint8_t>(rng());
+    }
+
+    // partial copies of the text, so text patterns have near misses
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        size_t position = rng() % (size - 64);
+        memcpy(&image[position], text, std::min<size_t>(strlen(text), 5 + rng() % 30));
+    }
+
+    // and one full copy
+    memcpy(&image[size / 3], text, strlen(text));
+    return image;
+}
+
+struct bench_case_t
+{
+    const char* name;
+    compiled_pattern_t pattern;
+};
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = 64;
+    bool matches_only = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--matches-only") == 0)
+            matches_only = true;
+        else
+            megabytes = std::strtoul(argv[i], nullptr, 10);
+    }
+
+    std::vector<uint8_t> image = synthetic_image(std::max<size_t>(megabytes, 1) << 20, 7);
+    byte_histogram_t histogram = build_histogram(image.data(), image.size());
+
+    text_options_t ascii;
+    text_options_t any_text;
+    any_text.encodings = encoding_ascii | encoding_utf16le;
+    any_text.ignore_case = true;
+
+    std::vector<bench_case_t> cases = {
+        { "long text", compile_text("Welcome to Trial Version of the program", ascii) },
+        { "long text, utf16+ascii nocase", compile_text("Welcome to Trial Version of the program", any_text) },
+        { "short text, utf16+ascii nocase", compile_text("Trial", any_text) },
+        { "short opcodes, rare bytes", compile_tokens(parse_pattern("E8????????84C0740A")) },
+        { "endbr64", compile_tokens(parse_pattern("F30F1EFA")) },
+        { "wildcard heavy", compile_tokens(parse_pattern("8B??89??48????8B??74")) },
+        { "wildcard heavy, common bytes", compile_tokens(parse_pattern("??00??FF??00??FF")) },
+        { "zero padded", compile_tokens(parse_pattern("00??00??00??00??00")) },
+        { "zero/ff mixed", compile_tokens(parse_pattern("00??FF??00??????00FF??00")) },
+    };
+
+    int failures = 0;
+    for (auto& bench_case : cases)
+    {
+        plan_t plan = plan_scan(bench_case.pattern, histogram);
+        printf("%s\n  plan: %s\n", bench_case.name, plan.describe().c_str());
+
+        std::vector<scan_match_t> reference;
+        double times[kernel_count] = {};
+        int fastest = -1;
+
+        for (uint32_t k = 0; k < kernel_count; k++)
+        {
+            if (plan.cost[k] < 0)
+                continue;
+
+            plan_t forced = plan;
+            forced.kernel = static_cast<kernel_t>(k);
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<scan_match_t> matches = scan(bench_case.pattern, forced, image.data(), image.size());
+            times[k] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            bool same = fastest == -1 || matches.size() == reference.size();
+            for (size_t i = 0; same && fastest != -1 && i < matches.size(); i++)
+                same = matches[i].address == reference[i].address && matches[i].variant == reference[i].variant;
+
+            if (!same)
+            {
+                printf("  %s: matches differ from the other kernels\n", kernel_names[k]);
+                failures++;
+            }
+
+            if (fastest == -1)
+                reference = matches;
+            if (fastest == -1 || times[k] < times[fastest])
+                fastest = k;
+
+            printf("  %-10s %9.2f ms, %zu matches\n", kernel_names[k], times[k], matches.size());
+        }
+
+        bool picked = times[plan.kernel] <= times[fastest] * 1.1;
+        printf("  picked %s, fastest %s: %s\n", kernel_names[plan.kernel], kernel_names[fastest], picked ? "ok" : "MISS");
+        if (!picked && !matches_only)
+            failures++;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -1,8 +1,18 @@
 ﻿#include "patterns.hpp"
+#include "scanner.hpp"
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <iterator>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 static std::error_code fs_err;
@@ -40,8 +50,45 @@ static std::string UnescapeString(const std::string& s) {
     return result;
 }
 
-bool IsHexString(const std::string& str) {
+// A token of a hex line with wildcards: a byte ("8B"), a wildcard byte ("?" or "??" as IDA writes it)
+// or the notation of patterns.hpp, which starts and ends with a byte and has one '?' per byte ("E8????84C0")
+static bool IsWildcardHexToken(const std::string& token) {
+    if (token == "?" || token == "??") return true;
+    if (token.find('?') == std::string::npos) return token.size() == 2 && std::isxdigit(static_cast<unsigned char>(token[0])) && std::isxdigit(static_cast<unsigned char>(token[1]));
+    if (!std::isxdigit(static_cast<unsigned char>(token.front())) || !std::isxdigit(static_cast<unsigned char>(token.back()))) return false;
+
+    size_t digits = 0;
+    for (char ch : token) {
+        if (ch == '?') {
+            if (digits % 2) return false;
+            digits = 0;
+        }
+        else if (std::isxdigit(static_cast<unsigned char>(ch))) digits++;
+        else return false;
+    }
+    return digits % 2 == 0;
+}
+
+// Every token must be one of the above, so text like "Bad?" or "Face?" is never read as hex
+static bool IsWildcardHexString(const std::string& str) {
+    std::istringstream stream(str);
+    std::string token;
+    bool hasHex = false;
+    while (stream >> token) {
+        if (!IsWildcardHexToken(token)) return false;
+        hasHex |= token != "?" && token != "??";
+    }
+    return hasHex;
+}
+
+// Only hex digits, spaces and '?', but not a valid wildcard pattern ("E8 ???? 84")
+static bool LooksLikeWildcardHex(const std::string& str) {
+    return str.find('?') != std::string::npos && std::all_of(str.begin(), str.end(), [](char ch) { return ch == ' ' || ch == '?' || std::isxdigit(static_cast<unsigned char>(ch)); });
+}
+
+bool IsHexString(const std::string& str, bool allowWildcards = false) {
     if (str.empty()) return false;
+    if (allowWildcards && str.find('?') != std::string::npos) return IsWildcardHexString(str);
 
     bool hasHex = false;
     for (char ch : str) {
@@ -55,12 +102,22 @@ bool IsHexString(const std::string& str) {
     return hasHex;
 }
 
-std::vector<uint8_t> HexStringToBytes(const std::string& hexStr) {
-    std::vector<uint8_t> bytes;
+// Both lines of a patch pair nibbles with the spaces removed ("DEA DBEEF" is DE AD BE EF),
+// a trailing odd nibble is dropped and a "??" wildcard becomes the single '?' of the pattern syntax
+static std::string CleanHexString(const std::string& hexStr) {
     std::string clean;
     clean.reserve(hexStr.size());
 
-    for (char c : hexStr) if (c != ' ') clean.push_back(c);
+    std::istringstream stream(hexStr);
+    for (std::string token; stream >> token;) clean += token == "??" ? "?" : token;
+    if (clean.find('?') == std::string::npos && clean.size() % 2) clean.pop_back();
+
+    return clean;
+}
+
+std::vector<uint8_t> HexStringToBytes(const std::string& hexStr) {
+    std::vector<uint8_t> bytes;
+    std::string clean = CleanHexString(hexStr);
 
     for (size_t i = 0; i + 1 < clean.size(); i += 2) {
         auto byte = static_cast<uint8_t>(std::stoul(clean.substr(i, 2), nullptr, 16));
@@ -70,56 +127,232 @@ std::vector<uint8_t> HexStringToBytes(const std::string& hexStr) {
     return bytes;
 }
 
-bool ReadPatchFile(const fs::path& path, std::string& original, std::string& replacement) {
+#ifdef _WIN32
+static void LogMessage(const std::string& message) {
+    OutputDebugStringA(("[signature-scan-patcher] " + message + "\n").c_str());
+}
+
+static bool WriteMemory(uintptr_t address, const std::vector<uint8_t>& bytes, const std::vector<patterns::memory_range_t>& ranges) {
+    DWORD oldProtect;
+    if (!VirtualProtect(reinterpret_cast<void*>(address), bytes.size(), PAGE_EXECUTE_READWRITE, &oldProtect)) return false;
+    memcpy(reinterpret_cast<void*>(address), bytes.data(), bytes.size());
+    VirtualProtect(reinterpret_cast<void*>(address), bytes.size(), oldProtect, &oldProtect);
+    return true;
+}
+
+static void RestoreProtection(const std::vector<patterns::memory_range_t>& ranges) {}
+#else
+static void LogMessage(const std::string& message) {
+    static bool enabled = getenv("SIGNATURE_SCAN_PATCHER_LOG") != nullptr;
+    if (enabled) fprintf(stderr, "[signature-scan-patcher] %s\n", message.c_str());
+}
+
+// pages made writable so far, protected back by RestoreProtection once all patches are applied
+static std::vector<uintptr_t> unlockedPages;
+
+static const patterns::memory_range_t* FindRange(uintptr_t page, size_t pageSize, const std::vector<patterns::memory_range_t>& ranges) {
+    for (auto& range : ranges) {
+        if (page < range.begin + range.size && range.begin < page + pageSize) return &range;
+    }
+    return nullptr;
+}
+
+static bool WriteMemory(uintptr_t address, const std::vector<uint8_t>& bytes, const std::vector<patterns::memory_range_t>& ranges) {
+    if (bytes.empty()) return true;
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t first = address & ~(pageSize - 1);
+    uintptr_t last = (address + bytes.size() - 1) & ~(pageSize - 1);
+
+    // unlock the pages that are not writable yet, one mprotect per run of pages with the same protection
+    for (uintptr_t page = first; page <= last;) {
+        auto range = FindRange(page, pageSize, ranges);
+        if (!range) return false;
+
+        uintptr_t end = page;
+        while (end <= last && FindRange(end, pageSize, ranges) == range && !std::binary_search(unlockedPages.begin(), unlockedPages.end(), end)) end += pageSize;
+        if (end == page) { page += pageSize; continue; }
+
+        if (mprotect(reinterpret_cast<void*>(page), end - page, range->protection | PROT_WRITE) != 0) return false;
+        for (uintptr_t p = page; p < end; p += pageSize) unlockedPages.insert(std::upper_bound(unlockedPages.begin(), unlockedPages.end(), p), p);
+        page = end;
+    }
+
+    memcpy(reinterpret_cast<void*>(address), bytes.data(), bytes.size());
+    return true;
+}
+
+static void RestoreProtection(const std::vector<patterns::memory_range_t>& ranges) {
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for (size_t i = 0; i < unlockedPages.size();) {
+        auto range = FindRange(unlockedPages[i], pageSize, ranges);
+        size_t j = i + 1;
+        while (j < unlockedPages.size() && unlockedPages[j] == unlockedPages[j - 1] + pageSize && FindRange(unlockedPages[j], pageSize, ranges) == range) ++j;
+
+        mprotect(reinterpret_cast<void*>(unlockedPages[i]), unlockedPages[j - 1] + pageSize - unlockedPages[i], range->protection);
+        i = j;
+    }
+    unlockedPages.clear();
+}
+#endif
+
+struct PatchOptions {
+    patterns::text_options_t text;
+    uint32_t maxMismatches = 0; // @fuzzy=K, 0 = exact matches only
+};
+
+static bool IsDecimal(const std::string& str) {
+    return !str.empty() && str.size() <= 3 && std::all_of(str.begin(), str.end(), [](char ch) { return std::isdigit(static_cast<unsigned char>(ch)); });
+}
+
+// Option lines come after the two patch lines and start with '@', e.g. "@utf16 @ascii @nocase @fuzzy=2"
+static void ParseOptionLine(const std::string& line, PatchOptions& options, uint8_t& encodings) {
+    std::istringstream stream(line);
+    std::string option;
+    while (stream >> option) {
+        if (option == "@ascii") encodings |= patterns::encoding_ascii;
+        else if (option == "@utf16" || option == "@utf16le") encodings |= patterns::encoding_utf16le;
+        else if (option == "@nocase") options.text.ignore_case = true;
+        else if (option.rfind("@fuzzy=", 0) == 0 && IsDecimal(option.substr(7))) options.maxMismatches = std::stoul(option.substr(7));
+    }
+}
+
+bool ReadPatchFile(const fs::path& path, std::string& original, std::string& replacement, PatchOptions& options) {
     std::ifstream file(path);
     if (!file) return false;
     std::getline(file, original);
     std::getline(file, replacement);
+
+    uint8_t encodings = 0;
+    for (std::string line; std::getline(file, line);) {
+        auto start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line[start] == '@') ParseOptionLine(line, options, encodings);
+    }
+    if (encodings) options.text.encodings = encodings;
     return true;
 }
 
+// Relocates a signature that stopped matching exactly, only the closest match is used and only if it is unique
+static std::vector<patterns::scan_match_t> FindApproximate(const patterns::compiled_pattern_t& compiled, uint32_t maxMismatches, const std::vector<patterns::memory_range_t>& ranges, const std::string& name) {
+    // wildcards always match, so only the bytes that can mismatch count towards the limit
+    size_t fewest = SIZE_MAX;
+    for (auto& variant : compiled.variants) {
+        auto concrete = std::count_if(variant.classes.begin(), variant.classes.end(), [](const patterns::byte_class_t& cls) { return cls.count() < 256; });
+        fewest = std::min(fewest, static_cast<size_t>(concrete));
+    }
+    if (maxMismatches * 2 >= fewest) {
+        LogMessage(name + ": @fuzzy=" + std::to_string(maxMismatches) + " is too large for a pattern with " + std::to_string(fewest) + " non-wildcard bytes");
+        return {};
+    }
+
+    auto candidates = std::vector<patterns::approximate_match_t>();
+    for (auto& range : ranges) {
+        auto found = patterns::scan_approximate(compiled, maxMismatches, reinterpret_cast<const uint8_t*>(range.begin), range.size);
+        candidates.insert(candidates.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+    }
+    if (candidates.empty()) {
+        LogMessage(name + ": not found within " + std::to_string(maxMismatches) + " mismatches");
+        return {};
+    }
+    patterns::rank_approximate(candidates);
+
+    auto& best = candidates[0];
+    auto tied = std::count_if(candidates.begin(), candidates.end(), [&](const patterns::approximate_match_t& c) { return c.distance == best.distance; });
+    if (tied > 1) {
+        LogMessage(name + ": " + std::to_string(tied) + " candidates at distance " + std::to_string(best.distance) + ", not applied");
+        return {};
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", reinterpret_cast<void*>(best.address));
+    auto message = name + ": relocated to " + buf + " at distance " + std::to_string(best.distance) + ", mismatches at offsets";
+    for (auto offset : best.mismatches) message += " " + std::to_string(offset);
+    LogMessage(message);
+
+    return { { best.address, best.variant } };
+}
+
 void ApplyPatches() {
-    if (!fs::exists(PATCHES_DIR)) fs::create_directory(PATCHES_DIR, fs_err);
-    for (auto& entry : fs::directory_iterator(PATCHES_DIR)) {
-        if (!entry.is_regular_file()) continue;
+#ifdef _WIN32
+    if (!fs::exists(PATCHES_DIR, fs_err)) fs::create_directory(PATCHES_DIR, fs_err);
+#else
+    // preloaded into every child process too, don't leave ./patches wherever they run
+    if (!fs::exists(PATCHES_DIR, fs_err)) return;
+#endif
+    // runs in a static initializer / DllMain, nothing may throw from here
+    auto entries = fs::directory_iterator(PATCHES_DIR, fs_err);
+    if (fs_err) return;
+
+    auto ranges = patterns::loaded_ranges();
+    auto histograms = std::vector<patterns::byte_histogram_t>();
+    for (auto& range : ranges) {
+        histograms.push_back(patterns::build_histogram(reinterpret_cast<const uint8_t*>(range.begin), range.size));
+    }
+    for (; entries != fs::directory_iterator(); entries.increment(fs_err)) {
+        if (fs_err) break;
+        auto& entry = *entries;
+        if (!entry.is_regular_file(fs_err)) continue;
 
         auto orig = std::string();
         auto repl = std::string();
-        if (!ReadPatchFile(entry.path(), orig, repl)) continue;
+        auto options = PatchOptions();
+        if (!ReadPatchFile(entry.path(), orig, repl, options)) continue;
 
-        auto origHex = IsHexString(orig);
+        auto origHex = IsHexString(orig, true);
         auto replHex = IsHexString(repl);
+        if (!origHex && LooksLikeWildcardHex(orig)) LogMessage(entry.path().filename().string() + ": not a valid wildcard pattern, searched as text");
 
-        auto origData = origHex ? orig : UnescapeString(orig);
+        auto origData = origHex ? CleanHexString(orig) : UnescapeString(orig);
         auto replData = replHex ? repl : UnescapeString(repl);
 
-        auto origBytes = origHex ? HexStringToBytes(origData) : std::vector<uint8_t>(origData.begin(), origData.end());
-        auto replBytes = replHex ? HexStringToBytes(replData) : std::vector<uint8_t>(replData.begin(), replData.end());
-
-        auto pattern = std::string();
-        pattern.reserve(origBytes.size() * 2);
-        for (auto b : origBytes) {
-            char buf[3];
-            snprintf(buf, sizeof(buf), "%02X", b);
-            pattern += buf;
+        auto compiled = origHex
+            ? patterns::compile_tokens(patterns::parse_pattern(origData))
+            : patterns::compile_text(origData, options.text);
+        if (compiled.variants.empty()) {
+            LogMessage(entry.path().filename().string() + ": pattern can't be compiled");
+            continue;
         }
 
-        auto addresses = patterns::find_patterns(pattern);
-        if (addresses.empty()) continue;
+        // the plan of the largest range is logged, other ranges only if they use a different kernel
+        auto matches = std::vector<patterns::scan_match_t>();
+        auto plans = std::vector<patterns::plan_t>();
+        size_t largest = 0;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            plans.push_back(patterns::plan_scan(compiled, histograms[i]));
+            if (ranges[i].size > ranges[largest].size) largest = i;
 
-        for (auto addr : addresses) {
-            size_t origSize = origBytes.size();
-            size_t replSize = replBytes.size();
-            size_t toWrite = replSize;//std::min(origSize, replSize);
+            auto found = patterns::scan(compiled, plans[i], reinterpret_cast<const uint8_t*>(ranges[i].begin), ranges[i].size);
+            matches.insert(matches.end(), found.begin(), found.end());
+        }
+        for (size_t i = 0; i < plans.size(); ++i) {
+            if (i == largest) LogMessage(entry.path().filename().string() + ": " + plans[i].describe());
+            else if (plans[i].kernel != plans[largest].kernel) LogMessage(entry.path().filename().string() + " (range " + std::to_string(i) + "): " + plans[i].describe());
+        }
+        if (matches.empty() && options.maxMismatches > 0) {
+            matches = FindApproximate(compiled, options.maxMismatches, ranges, entry.path().filename().string());
+        }
+        if (matches.empty()) {
+            if (options.maxMismatches == 0) LogMessage(entry.path().filename().string() + ": not found");
+            continue;
+        }
+
+        // text replacement is re-encoded to the encoding the original was found in
+        auto replBytes = std::vector<std::vector<uint8_t>>();
+        for (auto& variant : compiled.variants) {
+            replBytes.push_back(replHex ? HexStringToBytes(replData) : patterns::encode_text(replData, variant.encoding));
+        }
 
-            DWORD oldProtect;
-            VirtualProtect(reinterpret_cast<void*>(addr), toWrite, PAGE_EXECUTE_READWRITE, &oldProtect);
-            memcpy(reinterpret_cast<void*>(addr), replBytes.data(), toWrite);
-            VirtualProtect(reinterpret_cast<void*>(addr), toWrite, oldProtect, &oldProtect);
+        for (auto& match : matches) {
+            if (!WriteMemory(match.address, replBytes[match.variant], ranges)) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%p", reinterpret_cast<void*>(match.address));
+                LogMessage(entry.path().filename().string() + ": failed to write at " + buf);
+            }
         }
     }
+    RestoreProtection(ranges);
 }
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD reason, LPVOID lpReserved) {
     if (reason == DLL_PROCESS_ATTACH) {
         DisableThreadLibraryCalls(hModule);
@@ -127,3 +360,10 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD reason, LPVOID lpReserved) {
     }
     return TRUE;
 }
+#else
+// runs when the shared object is loaded with LD_PRELOAD, before main() of the target
+// (a static object rather than __attribute__((constructor)), so the globals above are constructed first)
+static struct OnLoad {
+    OnLoad() { ApplyPatches(); }
+} onLoad;
+#endif
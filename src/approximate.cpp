@@ -0,0 +1,174 @@
+#include <scanner.hpp>
+
+#include <algorithm>
+#include <bit>
+
+namespace patterns
+{
+    void rank_approximate(std::vector<approximate_match_t>& matches)
+    {
+        std::sort(matches.begin(), matches.end(), [](const approximate_match_t& a, const approximate_match_t& b)
+        {
+            if (a.distance != b.distance)
+                return a.distance < b.distance;
+            if (a.address != b.address)
+                return a.address < b.address;
+            return a.variant < b.variant;
+        });
+    }
+
+    std::vector<approximate_match_t> scan_approximate(const compiled_pattern_t& pattern, uint32_t max_distance, const uint8_t* data, size_t size)
+    {
+        std::vector<approximate_match_t> matches;
+        if (pattern.variants.empty())
+            return matches;
+
+        // every position of every variant gets a bit in the state words
+        size_t length = 0;
+        std::vector<size_t> variant_ends;
+        for (auto& variant : pattern.variants)
+        {
+            if (variant.classes.empty())
+                return matches;
+
+            length += variant.classes.size();
+            variant_ends.push_back(length - 1);
+        }
+
+        size_t words = (length + 63) / 64;
+        std::vector<uint64_t> mismatch(256 * words, 0); // positions that don't accept the byte value
+        std::vector<uint64_t> starts(words, 0);
+        std::vector<uint64_t> ends(words, 0);
+
+        size_t bit = 0;
+        for (auto& variant : pattern.variants)
+        {
+            starts[bit / 64] |= 1ull << (bit % 64);
+
+            for (auto& cls : variant.classes)
+            {
+                for (uint32_t b = 0; b < 256; b++)
+                {
+                    if (!cls.has(static_cast<uint8_t>(b)))
+                        mismatch[b * words + bit / 64] |= 1ull << (bit % 64);
+                }
+                bit++;
+            }
+
+            ends[(bit - 1) / 64] |= 1ull << ((bit - 1) % 64);
+        }
+
+        // the mismatch counter of every position is stored bit-sliced over several planes,
+        // counters start at 2^planes - (max_distance + 1), so a carry out of the top plane means too many mismatches
+        uint32_t planes = std::max<uint32_t>(1, std::bit_width(max_distance));
+        uint64_t initial = (1ull << planes) - (static_cast<uint64_t>(max_distance) + 1);
+
+        // reports every variant that ends at data[i] within max_distance
+        auto report = [&](size_t i, size_t w, uint64_t found)
+        {
+            while (found)
+            {
+                size_t end = w * 64 + std::countr_zero(found);
+                found &= found - 1;
+
+                uint32_t v = static_cast<uint32_t>(std::lower_bound(variant_ends.begin(), variant_ends.end(), end) - variant_ends.begin());
+                auto& variant = pattern.variants[v];
+                const uint8_t* start = data + i + 1 - variant.classes.size();
+
+                approximate_match_t match;
+                match.address = reinterpret_cast<uintptr_t>(start);
+                match.variant = v;
+
+                for (uint32_t j = 0; j < variant.classes.size(); j++)
+                {
+                    if (!variant.classes[j].has(start[j]))
+                        match.mismatches.push_back(j);
+                }
+
+                match.distance = static_cast<uint32_t>(match.mismatches.size());
+                matches.push_back(match);
+            }
+        };
+
+        // most signatures fit a single word, keep its state in registers
+        if (words == 1 && planes <= 8)
+        {
+            uint64_t plane[8] = {};
+            uint64_t over = ~0ull; // nothing before the start of the memory matches
+            uint64_t start_bits = starts[0];
+            uint64_t end_bits = ends[0];
+
+            for (size_t i = 0; i < size; i++)
+            {
+                over = (over << 1) & ~start_bits;
+
+                uint64_t carry = mismatch[data[i]];
+                for (uint32_t p = 0; p < planes; p++)
+                {
+                    uint64_t value = (plane[p] << 1 & ~start_bits) | (((initial >> p) & 1) ? start_bits : 0);
+                    plane[p] = value ^ carry;
+                    carry &= value;
+                }
+                over |= carry;
+
+                if (end_bits & ~over)
+                    report(i, 0, end_bits & ~over);
+            }
+        }
+        else
+        {
+            // one word per plane more than needed, the first one stays zero and is shifted into the lowest word
+            size_t stride = words + 1;
+            std::vector<uint64_t> state((planes + 1) * stride, 0);
+            for (size_t w = 1; w <= words; w++)
+                state[planes * stride + w] = ~0ull; // nothing before the start of the memory matches
+
+            for (size_t i = 0; i < size; i++)
+            {
+                const uint64_t* miss = &mismatch[data[i] * words];
+
+                // from the last word down, so the lower word is shifted after its top bit was carried over
+                for (size_t w = words; w > 0; w--)
+                {
+                    uint64_t start_bits = starts[w - 1];
+                    uint64_t carry = miss[w - 1];
+
+                    // move every counter one position further, start a new alignment of every variant
+                    // at this byte and add the mismatches of this byte
+                    for (uint32_t p = 0; p < planes; p++)
+                    {
+                        uint64_t* plane = &state[p * stride + w];
+                        uint64_t value = (((plane[0] << 1) | (plane[-1] >> 63)) & ~start_bits) | (((initial >> p) & 1) ? start_bits : 0);
+                        plane[0] = value ^ carry;
+                        carry &= value;
+                    }
+
+                    uint64_t* over = &state[planes * stride + w];
+                    over[0] = ((((over[0] << 1) | (over[-1] >> 63)) & ~start_bits)) | carry;
+
+                    if (ends[w - 1] & ~over[0])
+                        report(i, w - 1, ends[w - 1] & ~over[0]);
+                }
+            }
+        }
+
+        // keep the closest variant of every address
+        std::sort(matches.begin(), matches.end(), [](const approximate_match_t& a, const approximate_match_t& b)
+        {
+            if (a.address != b.address)
+                return a.address < b.address;
+            if (a.distance != b.distance)
+                return a.distance < b.distance;
+            return a.variant < b.variant;
+        });
+
+        auto end = std::unique(matches.begin(), matches.end(), [](const approximate_match_t& a, const approximate_match_t& b)
+        {
+            return a.address == b.address;
+        });
+        matches.erase(end, matches.end());
+
+        rank_approximate(matches);
+        return matches;
+    }
+}
@@ -1,6 +1,14 @@
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <Psapi.h>
+#else
+#include <link.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
 #include <string>
 #include <cstdlib>
 #include <cstdint>
@@ -205,16 +213,182 @@ namespace patterns
         return bytes;
     }
 
-    std::vector<uintptr_t> find_pattern(std::vector<token_t> pattern, std::string library)
+#ifdef _WIN32
+    std::vector<memory_range_t> module_ranges(std::string library)
+    {
+        HMODULE module = (HMODULE)module_base(library);
+        if (module == nullptr)
+            return {};
+
+        MODULEINFO module_info;
+        if (!GetModuleInformation(GetCurrentProcess(), module, &module_info, sizeof(MODULEINFO)))
+            return {};
+
+        return { { (uintptr_t)module, module_info.SizeOfImage, 0 } };
+    }
+
+    uintptr_t module_base(std::string library)
     {
-        // get module handle
-        HMODULE module;
         if (library == "")
-            module = GetModuleHandle(0);
+            return (uintptr_t)GetModuleHandle(0);
         else
-            module = GetModuleHandle(library.c_str());
+            return (uintptr_t)GetModuleHandle(library.c_str());
+    }
 
-        if (module == nullptr)
+    std::vector<memory_range_t> loaded_ranges()
+    {
+        return module_ranges();
+    }
+#else
+    // dl_iterate_phdr context for looking up a single module
+    struct module_search_t
+    {
+        std::string library;
+        bool found;
+        uintptr_t base;
+        std::vector<memory_range_t> ranges;
+    };
+
+    bool is_module(const char* name, const std::string& library)
+    {
+        // the main program is reported first and has no name
+        if (library == "")
+            return name == nullptr || name[0] == 0;
+
+        if (name == nullptr)
+            return false;
+
+        std::string path = name;
+        return path == library || path.substr(path.rfind('/') + 1) == library;
+    }
+
+    void add_range(std::vector<memory_range_t>& ranges, uintptr_t begin, uintptr_t end, int protection)
+    {
+        if (begin < end)
+            ranges.push_back({ begin, end - begin, protection });
+    }
+
+    // Adds every readable PT_LOAD segment of a module (split at PT_GNU_RELRO)
+    void add_segments(dl_phdr_info* info, std::vector<memory_range_t>& ranges)
+    {
+        // relro pages were made read-only after relocation, the loader rounds both ends down to a page,
+        // so the rest of the last page (usually .got.plt or .data) stays writable
+        uintptr_t page_mask = ~(static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1);
+        uintptr_t relro_begin = 0;
+        uintptr_t relro_end = 0;
+        for (uint32_t i = 0; i < info->dlpi_phnum; i++)
+        {
+            if (info->dlpi_phdr[i].p_type == PT_GNU_RELRO)
+            {
+                uintptr_t begin = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+                relro_begin = begin & page_mask;
+                relro_end = (begin + info->dlpi_phdr[i].p_memsz) & page_mask;
+            }
+        }
+
+        // only loaded segments that can be read
+        for (uint32_t i = 0; i < info->dlpi_phnum; i++)
+        {
+            auto& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_R))
+                continue;
+
+            uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+            uintptr_t end = begin + phdr.p_memsz;
+
+            int protection = PROT_READ;
+            if (phdr.p_flags & PF_W)
+                protection |= PROT_WRITE;
+            if (phdr.p_flags & PF_X)
+                protection |= PROT_EXEC;
+
+            add_range(ranges, begin, std::min(end, relro_begin), protection);
+            add_range(ranges, std::max(begin, relro_begin), std::min(end, relro_end), PROT_READ);
+            add_range(ranges, std::max(begin, relro_end), end, protection);
+        }
+    }
+
+    int search_module(dl_phdr_info* info, size_t, void* data)
+    {
+        module_search_t* search = (module_search_t*)data;
+        if (!is_module(info->dlpi_name, search->library))
+            return 0;
+
+        search->found = true;
+        search->base = info->dlpi_addr;
+        add_segments(info, search->ranges);
+
+        return 1;
+    }
+
+    // dl_iterate_phdr context for collecting every loaded module but a few
+    struct loaded_search_t
+    {
+        std::vector<uintptr_t> excluded; // an address inside every module to skip
+        std::vector<memory_range_t> ranges;
+    };
+
+    bool contains(dl_phdr_info* info, uintptr_t address)
+    {
+        for (uint32_t i = 0; i < info->dlpi_phnum; i++)
+        {
+            auto& phdr = info->dlpi_phdr[i];
+            uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_type == PT_LOAD && address >= begin && address < begin + phdr.p_memsz)
+                return true;
+        }
+
+        return false;
+    }
+
+    int search_loaded(dl_phdr_info* info, size_t, void* data)
+    {
+        loaded_search_t* search = (loaded_search_t*)data;
+        for (uintptr_t address : search->excluded)
+        {
+            if (address != 0 && contains(info, address))
+                return 0;
+        }
+
+        add_segments(info, search->ranges);
+        return 0;
+    }
+
+    module_search_t find_module(std::string library)
+    {
+        module_search_t search;
+        search.library = library;
+        search.found = false;
+        search.base = 0;
+        dl_iterate_phdr(search_module, &search);
+        return search;
+    }
+
+    std::vector<memory_range_t> module_ranges(std::string library)
+    {
+        return find_module(library).ranges;
+    }
+
+    uintptr_t module_base(std::string library)
+    {
+        return find_module(library).base;
+    }
+
+    std::vector<memory_range_t> loaded_ranges()
+    {
+        // this library, the vdso and the dynamic loader
+        loaded_search_t search;
+        search.excluded = { (uintptr_t)&loaded_ranges, (uintptr_t)getauxval(AT_SYSINFO_EHDR), (uintptr_t)getauxval(AT_BASE) };
+        dl_iterate_phdr(search_loaded, &search);
+        return search.ranges;
+    }
+#endif
+
+    std::vector<uintptr_t> find_pattern(std::vector<token_t> pattern, std::string library)
+    {
+        // get module memory
+        std::vector<memory_range_t> ranges = module_ranges(library);
+        if (ranges.empty())
             return {};
 
         bool search_all = false;
@@ -226,80 +400,78 @@ namespace patterns
             pattern.erase(pattern.begin());
         }
 
-        // get module info
-        MODULEINFO module_info;
-        if (!GetModuleInformation(GetCurrentProcess(), module, &module_info, sizeof(MODULEINFO)))
-            return {};
-
         std::vector<uintptr_t> addresses;
 
-        // iterate over module memory
-        for (uint32_t i = 0; i < module_info.SizeOfImage; i++)
+        // iterate over memory of every module range
+        for (auto& range : ranges)
         {
-            bool found = true;
-            void* address = (void*)((uintptr_t)module + i);
-            void* addr = address;
-            bool set_address_cursor = false;
-            uint32_t subtracted_bytes = 0;
-            uint32_t max_jump_length = -1;
-
-            // iterate over pattern tokens
-            for (uint32_t j = 0; j < pattern.size(); j++)
+            for (size_t i = 0; i < range.size; i++)
             {
-                // check if we need to set the address cursor
-                if (pattern[j].set_address_cursor)
+                bool found = true;
+                void* address = (void*)(range.begin + i);
+                void* addr = address;
+                bool set_address_cursor = false;
+                uint32_t subtracted_bytes = 0;
+                uint32_t max_jump_length = -1;
+
+                // iterate over pattern tokens
+                for (uint32_t j = 0; j < pattern.size(); j++)
                 {
-                    // set address to current address
-                    addr = (void*)((uintptr_t)address + j);
-                    set_address_cursor = true;
-                    continue;
-                }
-
-                // if cursor has been set, we need to offset j by 1
-                uintptr_t addr = (uintptr_t)address + (set_address_cursor ? j - 1 : j) - subtracted_bytes;
-
-                // check if we have enough memory left
-                if (addr >= (uintptr_t)module + module_info.SizeOfImage)
-                {
-                    found = false;
-                    break;
-                }
+                    // check if we need to set the address cursor
+                    if (pattern[j].set_address_cursor)
+                    {
+                        // set address to current address
+                        addr = (void*)((uintptr_t)address + j);
+                        set_address_cursor = true;
+                        continue;
+                    }
 
-                if (pattern[j].jump_if_fail != -1 && max_jump_length == -1)
-                {
-                    max_jump_length = pattern[j].jump_if_fail;
-                }
-                else if (pattern[j].jump_if_fail == -1)
-                {
-                    max_jump_length = -1;
-                }
+                    // if cursor has been set, we need to offset j by 1
+                    uintptr_t addr = (uintptr_t)address + (set_address_cursor ? j - 1 : j) - subtracted_bytes;
 
-                // check if we have a match
-                if (!pattern[j].any_byte && *(uint8_t*)(addr) != pattern[j].byte)
-                {
-                    // check if has "jump_if_fail" set
-                    if (pattern[j].jump_if_fail != -1)
+                    // check if we have enough memory left
+                    if (addr >= range.begin + range.size)
                     {
-                        // jump to the next token
-                        j += pattern[j].jump_if_fail;
+                        found = false;
+                        break;
+                    }
 
-                        // we also need to make sure we return to the original address before the [] brackets
-                        subtracted_bytes += max_jump_length + 1;
-                        continue;
+                    if (pattern[j].jump_if_fail != -1 && max_jump_length == -1)
+                    {
+                        max_jump_length = pattern[j].jump_if_fail;
+                    }
+                    else if (pattern[j].jump_if_fail == -1)
+                    {
+                        max_jump_length = -1;
                     }
 
-                    found = false;
-                    break;
+                    // check if we have a match
+                    if (!pattern[j].any_byte && *(uint8_t*)(addr) != pattern[j].byte)
+                    {
+                        // check if has "jump_if_fail" set
+                        if (pattern[j].jump_if_fail != -1)
+                        {
+                            // jump to the next token
+                            j += pattern[j].jump_if_fail;
+
+                            // we also need to make sure we return to the original address before the [] brackets
+                            subtracted_bytes += max_jump_length + 1;
+                            continue;
+                        }
+
+                        found = false;
+                        break;
+                    }
                 }
-            }
 
-            // return address offset for base address
-            if (found)
-            {
-                if (search_all)
-                    addresses.push_back((uintptr_t)addr);
-                else
-                    return { (uintptr_t)addr };
+                // return address offset for base address
+                if (found)
+                {
+                    if (search_all)
+                        addresses.push_back((uintptr_t)addr);
+                    else
+                        return { (uintptr_t)addr };
+                }
             }
         }
 
@@ -340,11 +512,7 @@ namespace patterns
         for (auto& address : addresses)
         {
             // address is the base address, so we need to offset it
-            uintptr_t module_addr;
-            if (library == "")
-                module_addr = (uintptr_t)GetModuleHandle(0);
-            else
-                module_addr = (uintptr_t)GetModuleHandle(library.c_str());
+            uintptr_t module_addr = module_base(library);
 
             opcode_t opcode;
             opcode.address = (void*)((uintptr_t)address - module_addr);
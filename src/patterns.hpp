@@ -1,6 +1,8 @@
 #pragma once
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#endif
 #include <random>
 #include <cstdint>
 
@@ -156,6 +158,25 @@ namespace patterns
         }
     };
 
+    // A readable memory region of a loaded module
+    struct memory_range_t
+    {
+        uintptr_t begin;
+        size_t size;
+        int protection; // PROT_* flags of the region on linux, 0 on windows
+    };
+
+    // Returns the memory regions of a library (or of the main module if library is empty)
+    // On windows this is the whole image, on linux every readable PT_LOAD segment (split at PT_GNU_RELRO)
+    std::vector<memory_range_t> module_ranges(std::string library = "");
+
+    // Returns the memory regions patches are applied to: on windows the main module,
+    // on linux the main program and every shared object it loaded, except this library, the vdso and the dynamic loader
+    std::vector<memory_range_t> loaded_ranges();
+
+    // Returns the base address of a library (or of the main module if library is empty), 0 if it is not loaded
+    uintptr_t module_base(std::string library = "");
+
     // Parses a pattern string and returns a vector of tokens
     std::vector<token_t> parse_pattern(std::string pattern);
 
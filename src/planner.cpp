@@ -0,0 +1,285 @@
+#include <scanner.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace patterns
+{
+    // most bytes sampled for a histogram, larger ranges are sampled with a stride
+    constexpr size_t max_histogram_samples = 1 << 20;
+
+    // relative costs of the kernel steps, measured on synthetic images
+    constexpr double cost_position = 1.0;  // visiting a position in a scalar loop
+    constexpr double cost_compare = 1.0;   // comparing one byte against a class
+    constexpr double cost_vector = 1.2;    // one 16 byte vector compare
+    constexpr double cost_candidate = 4.0; // extracting a candidate from a vector mask
+    constexpr double cost_skip = 4.5;      // one horspool window step
+    constexpr double cost_shift_and = 0.8; // one shift-and step
+
+    const char* kernel_names[kernel_count] = { "naive", "anchor", "horspool", "shift-and" };
+
+    byte_histogram_t build_histogram(const uint8_t* data, size_t size)
+    {
+        size_t counts[256] = {};
+        size_t stride = std::max<size_t>(1, size / max_histogram_samples);
+        size_t samples = 0;
+
+        for (size_t i = 0; i < size; i += stride)
+        {
+            counts[data[i]]++;
+            samples++;
+        }
+
+        // smoothed, so bytes that were not sampled are rare but possible
+        byte_histogram_t histogram;
+        for (uint32_t b = 0; b < 256; b++)
+            histogram.frequency[b] = (counts[b] + 0.5) / (samples + 128.0);
+
+        return histogram;
+    }
+
+    // Chance that a random byte of the memory is accepted by a class
+    double class_probability(const byte_class_t& cls, const byte_histogram_t& histogram)
+    {
+        double probability = 0;
+        for (uint32_t b = 0; b < 256; b++)
+        {
+            if (cls.has(static_cast<uint8_t>(b)))
+                probability += histogram.frequency[b];
+        }
+        return std::min(probability, 1.0);
+    }
+
+    // Expected number of class compares to verify all variants at a random position
+    double verify_cost(const compiled_pattern_t& pattern, const std::vector<std::vector<double>>& probabilities)
+    {
+        double cost = 0;
+        for (uint32_t v = 0; v < pattern.variants.size(); v++)
+        {
+            double reach = 1;
+            for (double probability : probabilities[v])
+            {
+                cost += reach * cost_compare;
+                reach *= probability;
+            }
+        }
+        return cost;
+    }
+
+    anchor_t pick_anchor(const variant_t& variant, const std::vector<double>& probabilities)
+    {
+        anchor_t anchor;
+        anchor.offset = 0;
+        anchor.count = 256;
+
+        // the rarest class that still fits a vector compare, the one with fewer values otherwise
+        for (uint32_t i = 0; i < variant.classes.size(); i++)
+        {
+            uint32_t count = variant.classes[i].count();
+            bool fits = count <= max_anchor_values;
+            bool best_fits = anchor.count <= max_anchor_values;
+
+            if (fits && (!best_fits || probabilities[i] < probabilities[anchor.offset]))
+            {
+                anchor.offset = i;
+                anchor.count = count;
+            }
+            else if (!fits && !best_fits && count < anchor.count)
+            {
+                anchor.offset = i;
+                anchor.count = count;
+            }
+        }
+
+        if (anchor.count <= max_anchor_values)
+        {
+            uint32_t n = 0;
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                if (variant.classes[anchor.offset].has(static_cast<uint8_t>(b)))
+                    anchor.values[n++] = static_cast<uint8_t>(b);
+            }
+        }
+
+        return anchor;
+    }
+
+    double plan_anchor(const compiled_pattern_t& pattern, const std::vector<std::vector<double>>& probabilities, double verify, plan_t& plan)
+    {
+        double vector_work = 0;
+        double miss = 1;
+
+        for (uint32_t v = 0; v < pattern.variants.size(); v++)
+        {
+            anchor_t anchor = pick_anchor(pattern.variants[v], probabilities[v]);
+            plan.anchors.push_back(anchor);
+
+            if (anchor.count > max_anchor_values)
+                return -1;
+
+            vector_work += (anchor.count + 1) * cost_vector;
+            miss *= 1 - probabilities[v][anchor.offset];
+        }
+
+        plan.anchor_hit_rate = 1 - miss;
+
+#ifdef PATTERNS_SSE2
+        return vector_work / 16 + plan.anchor_hit_rate * (cost_candidate + verify);
+#else
+        return -1;
+#endif
+    }
+
+    double plan_horspool(const compiled_pattern_t& pattern, const byte_histogram_t& histogram, double verify, plan_t& plan)
+    {
+        size_t window = SIZE_MAX;
+        for (auto& variant : pattern.variants)
+            window = std::min(window, variant.classes.size());
+
+        plan.window = static_cast<uint32_t>(window);
+        for (uint32_t b = 0; b < 256; b++)
+            plan.shift[b] = plan.window;
+
+        // the smallest distance from the end of the window at which any variant accepts the byte
+        for (auto& variant : pattern.variants)
+        {
+            for (uint32_t i = 0; i + 1 < window; i++)
+            {
+                for (uint32_t b = 0; b < 256; b++)
+                {
+                    if (variant.classes[i].has(static_cast<uint8_t>(b)))
+                        plan.shift[b] = std::min<uint32_t>(plan.shift[b], plan.window - 1 - i);
+                }
+            }
+
+            for (uint32_t b = 0; b < 256; b++)
+            {
+                if (variant.classes[window - 1].has(static_cast<uint8_t>(b)))
+                    plan.last.add(static_cast<uint8_t>(b));
+            }
+        }
+
+        plan.average_shift = 0;
+        for (uint32_t b = 0; b < 256; b++)
+            plan.average_shift += histogram.frequency[b] * plan.shift[b];
+
+        double check = class_probability(plan.last, histogram);
+        return (cost_skip + check * verify) / std::max(plan.average_shift, 1.0);
+    }
+
+    double plan_shift_and(const compiled_pattern_t& pattern, plan_t& plan)
+    {
+        size_t length = 0;
+        for (auto& variant : pattern.variants)
+            length += variant.classes.size();
+
+        if (length > 64)
+            return -1;
+
+        plan.masks.assign(256, 0);
+        plan.starts = 0;
+        plan.ends = 0;
+
+        uint32_t bit = 0;
+        for (auto& variant : pattern.variants)
+        {
+            plan.starts |= 1ull << bit;
+
+            for (auto& cls : variant.classes)
+            {
+                for (uint32_t b = 0; b < 256; b++)
+                {
+                    if (cls.has(static_cast<uint8_t>(b)))
+                        plan.masks[b] |= 1ull << bit;
+                }
+                bit++;
+            }
+
+            plan.ends |= 1ull << (bit - 1);
+        }
+
+        return cost_shift_and;
+    }
+
+    plan_t plan_scan(const compiled_pattern_t& pattern, const byte_histogram_t& histogram)
+    {
+        plan_t plan;
+        plan.kernel = kernel_naive;
+        plan.anchor_hit_rate = 1;
+        plan.window = 0;
+        plan.average_shift = 1;
+        plan.starts = 0;
+        plan.ends = 0;
+
+        for (uint32_t k = 0; k < kernel_count; k++)
+            plan.cost[k] = -1;
+
+        for (auto& variant : pattern.variants)
+        {
+            if (variant.classes.empty())
+                return plan;
+        }
+
+        if (pattern.variants.empty())
+            return plan;
+
+        std::vector<std::vector<double>> probabilities;
+        for (auto& variant : pattern.variants)
+        {
+            std::vector<double> variant_probabilities;
+            for (auto& cls : variant.classes)
+                variant_probabilities.push_back(class_probability(cls, histogram));
+            probabilities.push_back(variant_probabilities);
+        }
+
+        double verify = verify_cost(pattern, probabilities);
+
+        plan.cost[kernel_naive] = cost_position + verify;
+        plan.cost[kernel_anchor] = plan_anchor(pattern, probabilities, verify, plan);
+        plan.cost[kernel_horspool] = plan_horspool(pattern, histogram, verify, plan);
+        plan.cost[kernel_shift_and] = plan_shift_and(pattern, plan);
+
+        for (uint32_t k = 0; k < kernel_count; k++)
+        {
+            if (plan.cost[k] >= 0 && plan.cost[k] < plan.cost[plan.kernel])
+                plan.kernel = static_cast<kernel_t>(k);
+        }
+
+        return plan;
+    }
+
+    std::string plan_t::describe() const
+    {
+        char buf[128];
+        std::string text = kernel_names[kernel];
+
+        switch (kernel)
+        {
+        case kernel_anchor:
+            snprintf(buf, sizeof(buf), " (%zu anchors, hit rate %.4f)", anchors.size(), anchor_hit_rate);
+            text += buf;
+            break;
+        case kernel_horspool:
+            snprintf(buf, sizeof(buf), " (window %u, avg shift %.2f)", window, average_shift);
+            text += buf;
+            break;
+        default:
+            break;
+        }
+
+        text += " |";
+        for (uint32_t k = 0; k < kernel_count; k++)
+        {
+            if (cost[k] < 0)
+                snprintf(buf, sizeof(buf), " %s n/a", kernel_names[k]);
+            else
+                snprintf(buf, sizeof(buf), " %s %.2f", kernel_names[k], cost[k]);
+
+            text += buf;
+            if (k + 1 < kernel_count)
+                text += ",";
+        }
+
+        return text;
+    }
+}
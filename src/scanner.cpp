@@ -0,0 +1,342 @@
+#include <scanner.hpp>
+
+#include <algorithm>
+#include <bit>
+
+#ifdef PATTERNS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace patterns
+{
+    uint32_t byte_class_t::count() const
+    {
+        return std::popcount(bits[0]) + std::popcount(bits[1]) + std::popcount(bits[2]) + std::popcount(bits[3]);
+    }
+
+    byte_class_t text_class(uint8_t ch, bool ignore_case)
+    {
+        byte_class_t cls;
+        cls.add(ch);
+
+        if (ignore_case)
+        {
+            if (ch >= 'a' && ch <= 'z')
+                cls.add(ch - 'a' + 'A');
+            else if (ch >= 'A' && ch <= 'Z')
+                cls.add(ch - 'A' + 'a');
+        }
+
+        return cls;
+    }
+
+    compiled_pattern_t compile_tokens(const std::vector<token_t>& tokens)
+    {
+        variant_t variant;
+        variant.encoding = encoding_raw;
+
+        for (auto& token : tokens)
+        {
+            // a '[]' group is optional, it can't be expressed as one list of classes
+            if (token.jump_if_fail != -1)
+                return {};
+
+            if (token.set_address_cursor || token.multi_pattern)
+                continue;
+
+            byte_class_t cls;
+            if (token.any_byte)
+                cls.add_all();
+            else
+                cls.add(token.byte);
+
+            variant.classes.push_back(cls);
+        }
+
+        compiled_pattern_t compiled;
+        compiled.variants.push_back(variant);
+        return compiled;
+    }
+
+    // Decodes utf-8 into utf-16 code units, code points above FFFF become surrogate pairs
+    // Bytes that are not valid utf-8 (e.g. from '\xFF' escapes) are taken as latin-1
+    std::vector<uint16_t> utf16_units(const std::string& text)
+    {
+        std::vector<uint16_t> units;
+        units.reserve(text.size());
+
+        for (size_t i = 0; i < text.size();)
+        {
+            uint8_t lead = static_cast<uint8_t>(text[i]);
+            uint32_t length = lead >= 0xF0 && lead <= 0xF4 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 1;
+            if (lead < 0x80 || lead > 0xF4 || i + length > text.size())
+                length = 1;
+
+            uint32_t code_point = length == 1 ? lead : lead & (0x7F >> length);
+            for (uint32_t j = 1; j < length; j++)
+            {
+                uint8_t next = static_cast<uint8_t>(text[i + j]);
+                if ((next & 0xC0) != 0x80)
+                {
+                    length = 1;
+                    code_point = lead;
+                    break;
+                }
+                code_point = (code_point << 6) | (next & 0x3F);
+            }
+
+            // overlong forms and surrogates are not valid utf-8 either
+            uint32_t smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+            if (length > 1 && (code_point < smallest[length] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF)))
+            {
+                length = 1;
+                code_point = lead;
+            }
+
+            if (code_point > 0xFFFF)
+            {
+                code_point -= 0x10000;
+                units.push_back(static_cast<uint16_t>(0xD800 | (code_point >> 10)));
+                units.push_back(static_cast<uint16_t>(0xDC00 | (code_point & 0x3FF)));
+            }
+            else
+            {
+                units.push_back(static_cast<uint16_t>(code_point));
+            }
+
+            i += length;
+        }
+
+        return units;
+    }
+
+    compiled_pattern_t compile_text(const std::string& text, text_options_t options)
+    {
+        compiled_pattern_t compiled;
+
+        // longer encodings go first so they win on the same address
+        for (auto encoding : { encoding_utf16le, encoding_ascii })
+        {
+            if (!(options.encodings & encoding))
+                continue;
+
+            variant_t variant;
+            variant.encoding = encoding;
+
+            if (encoding == encoding_utf16le)
+            {
+                for (uint16_t unit : utf16_units(text))
+                {
+                    byte_class_t high;
+                    high.add(static_cast<uint8_t>(unit >> 8));
+
+                    // only ascii letters have another case, their high byte is zero
+                    variant.classes.push_back(text_class(static_cast<uint8_t>(unit), options.ignore_case && unit < 0x80));
+                    variant.classes.push_back(high);
+                }
+            }
+            else
+            {
+                for (char ch : text)
+                    variant.classes.push_back(text_class(static_cast<uint8_t>(ch), options.ignore_case));
+            }
+
+            compiled.variants.push_back(variant);
+        }
+
+        return compiled;
+    }
+
+    std::vector<uint8_t> encode_text(const std::string& text, text_encoding_t encoding)
+    {
+        if (encoding != encoding_utf16le)
+            return std::vector<uint8_t>(text.begin(), text.end());
+
+        std::vector<uint8_t> bytes;
+        for (uint16_t unit : utf16_units(text))
+        {
+            bytes.push_back(static_cast<uint8_t>(unit));
+            bytes.push_back(static_cast<uint8_t>(unit >> 8));
+        }
+
+        return bytes;
+    }
+
+    bool match_variant(const variant_t& variant, const uint8_t* data)
+    {
+        for (uint32_t i = 0; i < variant.classes.size(); i++)
+        {
+            if (!variant.classes[i].has(data[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // Checks every variant at a single position, the first one that matches is stored
+    void verify_at(const compiled_pattern_t& pattern, const uint8_t* data, size_t size, size_t position, std::vector<scan_match_t>& matches)
+    {
+        for (uint32_t v = 0; v < pattern.variants.size(); v++)
+        {
+            auto& variant = pattern.variants[v];
+            if (position + variant.classes.size() > size)
+                continue;
+
+            if (match_variant(variant, data + position))
+            {
+                matches.push_back({ reinterpret_cast<uintptr_t>(data + position), v });
+                return;
+            }
+        }
+    }
+
+    void scan_naive(const compiled_pattern_t& pattern, const uint8_t* data, size_t size, size_t position, size_t last, std::vector<scan_match_t>& matches)
+    {
+        for (; position <= last; position++)
+            verify_at(pattern, data, size, position, matches);
+    }
+
+    void scan_anchor(const compiled_pattern_t& pattern, const plan_t& plan, const uint8_t* data, size_t size, size_t last, std::vector<scan_match_t>& matches)
+    {
+        size_t position = 0;
+
+#ifdef PATTERNS_SSE2
+        size_t max_offset = 0;
+        for (auto& anchor : plan.anchors)
+            max_offset = std::max<size_t>(max_offset, anchor.offset);
+
+        // test 16 positions at once against the anchor of every variant,
+        // only positions where some anchor fits are verified
+        for (; position + 16 + max_offset <= size; position += 16)
+        {
+            uint32_t mask = 0;
+            for (auto& anchor : plan.anchors)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position + anchor.offset));
+                __m128i hits = _mm_setzero_si128();
+
+                for (uint32_t i = 0; i < anchor.count; i++)
+                    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(static_cast<char>(anchor.values[i]))));
+
+                mask |= static_cast<uint32_t>(_mm_movemask_epi8(hits));
+            }
+
+            while (mask)
+            {
+                size_t candidate = position + std::countr_zero(mask);
+                mask &= mask - 1;
+
+                if (candidate <= last)
+                    verify_at(pattern, data, size, candidate, matches);
+            }
+        }
+#endif
+
+        scan_naive(pattern, data, size, position, last, matches);
+    }
+
+    void scan_horspool(const compiled_pattern_t& pattern, const plan_t& plan, const uint8_t* data, size_t size, size_t last, std::vector<scan_match_t>& matches)
+    {
+        size_t end = plan.window - 1;
+        for (size_t position = 0; position <= last;)
+        {
+            uint8_t byte = data[position + end];
+            if (plan.last.has(byte))
+                verify_at(pattern, data, size, position, matches);
+
+            position += plan.shift[byte];
+        }
+    }
+
+    void scan_shift_and(const compiled_pattern_t& pattern, const plan_t& plan, const uint8_t* data, size_t size, std::vector<scan_match_t>& matches)
+    {
+        // last position of every variant in the state word
+        std::vector<uint32_t> variant_ends;
+        uint32_t length = 0;
+        for (auto& variant : pattern.variants)
+        {
+            length += static_cast<uint32_t>(variant.classes.size());
+            variant_ends.push_back(length - 1);
+        }
+
+        uint64_t state = 0;
+        bool unordered = false;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            state = ((state << 1) | plan.starts) & plan.masks[data[i]];
+
+            uint64_t found = state & plan.ends;
+            while (found)
+            {
+                uint32_t bit = std::countr_zero(found);
+                found &= found - 1;
+
+                for (uint32_t v = 0; v < variant_ends.size(); v++)
+                {
+                    if (variant_ends[v] != bit)
+                        continue;
+
+                    size_t start = i + 1 - pattern.variants[v].classes.size();
+                    if (!matches.empty() && matches.back().address >= reinterpret_cast<uintptr_t>(data + start))
+                        unordered = true;
+
+                    matches.push_back({ reinterpret_cast<uintptr_t>(data + start), v });
+                }
+            }
+        }
+
+        // variants of different lengths are reported by their end, restore the order of the other kernels
+        if (unordered)
+        {
+            std::sort(matches.begin(), matches.end(), [](const scan_match_t& a, const scan_match_t& b)
+            {
+                return a.address != b.address ? a.address < b.address : a.variant < b.variant;
+            });
+
+            auto end = std::unique(matches.begin(), matches.end(), [](const scan_match_t& a, const scan_match_t& b)
+            {
+                return a.address == b.address;
+            });
+            matches.erase(end, matches.end());
+        }
+    }
+
+    std::vector<scan_match_t> scan(const compiled_pattern_t& pattern, const plan_t& plan, const uint8_t* data, size_t size)
+    {
+        std::vector<scan_match_t> matches;
+        if (pattern.variants.empty())
+            return matches;
+
+        size_t min_length = SIZE_MAX;
+        for (auto& variant : pattern.variants)
+            min_length = std::min(min_length, variant.classes.size());
+
+        if (min_length == 0 || size < min_length)
+            return matches;
+
+        size_t last = size - min_length;
+
+        switch (plan.kernel)
+        {
+        case kernel_anchor:
+            scan_anchor(pattern, plan, data, size, last, matches);
+            break;
+        case kernel_horspool:
+            scan_horspool(pattern, plan, data, size, last, matches);
+            break;
+        case kernel_shift_and:
+            scan_shift_and(pattern, plan, data, size, matches);
+            break;
+        default:
+            scan_naive(pattern, data, size, 0, last, matches);
+            break;
+        }
+
+        return matches;
+    }
+
+    std::vector<scan_match_t> scan(const compiled_pattern_t& pattern, const uint8_t* data, size_t size)
+    {
+        return scan(pattern, plan_scan(pattern, build_histogram(data, size)), data, size);
+    }
+}
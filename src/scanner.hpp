@@ -0,0 +1,205 @@
+#pragma once
+#include <patterns.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PATTERNS_SSE2 1
+#endif
+
+/*
+
+Compiled patterns:
+A pattern is compiled into one or more variants, every variant is a list of
+byte classes (the set of byte values accepted at that position).
+All variants of a pattern are matched in a single pass over the memory.
+
+Text patterns can be compiled for several encodings at once:
+"Trial" with ascii + utf16le + ignore_case gives two variants:
+1. [Tt] 00 [Rr] 00 [Ii] 00 [Aa] 00 [Ll] 00
+2. [Tt] [Rr] [Ii] [Aa] [Ll]
+The longer (utf16le) variant goes first, so it wins if both match at one address.
+
+Search plans:
+No single search algorithm is the fastest for every pattern, so before scanning
+a pattern is planned against the byte histogram of the memory. The planner
+estimates the cost per scanned byte of every kernel and picks the cheapest:
+- naive:     verifies every position
+- anchor:    SSE2 scan for the rarest class of every variant, verifies the hits
+             (short signatures with rare bytes)
+- horspool:  skips ahead by the byte under the end of the window
+             (long literal patterns, mostly text)
+- shift-and: bit-parallel, one step per byte regardless of wildcards
+             (wildcard heavy patterns, up to 64 bytes for all variants together)
+plan_t::describe() tells which kernel was picked and why.
+
+Approximate search:
+scan_approximate finds locations within k mismatching bytes (Hamming distance)
+of any variant, wildcards always match. Every pattern position keeps a small
+bit-sliced counter of mismatches (Shift-Add), so a step costs the same for any
+position of the pattern and the search stays linear in the memory size.
+It is meant to relocate signatures after the target was updated and one or
+two bytes of it changed.
+
+*/
+namespace patterns
+{
+    // Set of byte values accepted at one position of a compiled pattern
+    struct byte_class_t
+    {
+        uint64_t bits[4];
+
+        byte_class_t()
+        {
+            bits[0] = bits[1] = bits[2] = bits[3] = 0;
+        }
+
+        void add(uint8_t byte) { bits[byte >> 6] |= 1ull << (byte & 63); }
+        void add_all() { bits[0] = bits[1] = bits[2] = bits[3] = ~0ull; }
+        bool has(uint8_t byte) const { return (bits[byte >> 6] >> (byte & 63)) & 1; }
+
+        // Number of byte values in the class
+        uint32_t count() const;
+    };
+
+    // Encoding of a compiled variant
+    enum text_encoding_t : uint8_t
+    {
+        encoding_raw = 0,          // hex pattern, bytes are used as is
+        encoding_ascii = 1 << 0,   // one byte per character
+        encoding_utf16le = 1 << 1, // text is decoded as utf-8, two bytes per code unit (four above U+FFFF)
+    };
+
+    // How a text pattern should be compiled
+    struct text_options_t
+    {
+        uint8_t encodings; // combination of text_encoding_t flags
+        bool ignore_case;  // ascii letters match both cases
+
+        text_options_t()
+        {
+            encodings = encoding_ascii;
+            ignore_case = false;
+        }
+    };
+
+    // One alternative of a compiled pattern
+    struct variant_t
+    {
+        text_encoding_t encoding;
+        std::vector<byte_class_t> classes;
+    };
+
+    // A pattern compiled to byte class tables
+    struct compiled_pattern_t
+    {
+        std::vector<variant_t> variants;
+    };
+
+    // A single match of a compiled pattern
+    struct scan_match_t
+    {
+        uintptr_t address;
+        uint32_t variant; // index of the matched variant
+    };
+
+    // Search kernels a plan can use
+    enum kernel_t : uint8_t
+    {
+        kernel_naive,
+        kernel_anchor,
+        kernel_horspool,
+        kernel_shift_and,
+        kernel_count,
+    };
+
+    // Names of the kernels as used by plan_t::describe()
+    extern const char* kernel_names[kernel_count];
+
+    // how many byte values a class may have to be used as a vector anchor
+    constexpr uint32_t max_anchor_values = 4;
+
+    // Relative frequency of every byte value in the memory being searched
+    struct byte_histogram_t
+    {
+        double frequency[256];
+    };
+
+    // Position of the rarest class of a variant
+    struct anchor_t
+    {
+        uint32_t offset;
+        uint32_t count; // number of values in the class
+        uint8_t values[max_anchor_values];
+    };
+
+    // Search strategy for a compiled pattern, made by plan_scan
+    struct plan_t
+    {
+        kernel_t kernel;
+        double cost[kernel_count]; // estimated work per scanned byte, negative if the kernel can't be used
+
+        // kernel_anchor
+        std::vector<anchor_t> anchors;
+        double anchor_hit_rate; // chance that a position has to be verified
+
+        // kernel_horspool
+        uint32_t window;      // length of the shortest variant
+        uint32_t shift[256];  // how far to skip for the byte under the end of the window
+        byte_class_t last;    // bytes accepted at the end of the window by any variant
+        double average_shift;
+
+        // kernel_shift_and
+        std::vector<uint64_t> masks; // accepted positions of all variants for every byte value
+        uint64_t starts;             // first position of every variant
+        uint64_t ends;               // last position of every variant
+
+        // Which kernel was picked and why, e.g.
+        // "horspool (window 24, avg shift 19.20) | naive 1.35, anchor 0.42, horspool 0.16, shift-and 1.50"
+        std::string describe() const;
+    };
+
+    // A location within max_distance mismatches of a variant
+    struct approximate_match_t
+    {
+        uintptr_t address;
+        uint32_t variant;                 // index of the matched variant
+        uint32_t distance;                // number of mismatching bytes
+        std::vector<uint32_t> mismatches; // offsets of the mismatching bytes from address
+    };
+
+    // Compiles parsed pattern tokens (wildcards are supported, '^' and '*' are ignored)
+    // Returns a pattern without variants if the tokens contain a '[]' group
+    compiled_pattern_t compile_tokens(const std::vector<token_t>& tokens);
+
+    // Compiles text into one variant per requested encoding
+    compiled_pattern_t compile_text(const std::string& text, text_options_t options);
+
+    // Encodes text the same way compile_text does for the given encoding
+    std::vector<uint8_t> encode_text(const std::string& text, text_encoding_t encoding);
+
+    // Builds a histogram of [data, data + size), large ranges are sampled
+    byte_histogram_t build_histogram(const uint8_t* data, size_t size);
+
+    // Picks the cheapest kernel for a pattern,
+    // plan.kernel can be changed afterwards to any kernel with cost >= 0
+    plan_t plan_scan(const compiled_pattern_t& pattern, const byte_histogram_t& histogram);
+
+    // Finds all matches of every variant in [data, data + size) using a plan made for this pattern
+    // Matches are sorted by address, if several variants match at the same address only the first one is reported
+    std::vector<scan_match_t> scan(const compiled_pattern_t& pattern, const plan_t& plan, const uint8_t* data, size_t size);
+
+    // Same as above, plans against the histogram of the searched range
+    std::vector<scan_match_t> scan(const compiled_pattern_t& pattern, const uint8_t* data, size_t size);
+
+    // Finds all locations in [data, data + size) within max_distance mismatches of any variant
+    // Sorted by distance, then by address, every address is reported once with its closest variant
+    // max_distance should be well below the pattern length, otherwise almost every address matches
+    std::vector<approximate_match_t> scan_approximate(const compiled_pattern_t& pattern, uint32_t max_distance, const uint8_t* data, size_t size);
+
+    // Sorts approximate matches by distance, then by address
+    void rank_approximate(std::vector<approximate_match_t>& matches);
+}